@@ -9,13 +9,18 @@
 
 #include <asm/unaligned.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
 #include <linux/i2c.h>
+#include <linux/ktime.h>
 #include <linux/module.h>
 #include <linux/of_device.h>
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
+#include <linux/seq_file.h>
+#include <linux/workqueue.h>
 #include <media/v4l2-ctrls.h>
 #include <media/v4l2-device.h>
 #include <media/v4l2-event.h>
@@ -50,8 +55,6 @@ struct cci_reg_sequence {
 /*
  * TODOs
  *  - Move to active state api
- *  - Add 720 MBps speed mode to link_freq
- *    - HMAX/VMAX must be calculated based on link-freq to support this.
  *  - Support arbitrary cropping
  * 
  *  - account for the VOB
@@ -205,6 +208,16 @@ struct cci_reg_sequence {
 
 #define IMAGE_PAD			0
 
+/* Custom controls */
+#define V4L2_CID_IMX283_BASE		(V4L2_CID_USER_BASE + 0x2000)
+#define V4L2_CID_IMX283_BURST_FRAMES	(V4L2_CID_IMX283_BASE + 0)
+#define V4L2_CID_IMX283_BURST_TRIGGER	(V4L2_CID_IMX283_BASE + 1)
+#define V4L2_CID_IMX283_LOW_POWER	(V4L2_CID_IMX283_BASE + 2)
+#define V4L2_CID_IMX283_MIN_SKEW	(V4L2_CID_IMX283_BASE + 4)
+
+/* Margin either side of the standby write ending a burst */
+#define IMX283_BURST_SLACK_NS		10000000
+
 /* imx283 native and active pixel array size. */
 static const struct v4l2_rect imx283_native_area = {
 	.top = 0,
@@ -328,18 +341,24 @@ struct imx283_readout_mode {
 	u64 mdsel2;
 	u64 mdsel3;
 	u64 mdsel4;
+
+	/*
+	 * Rows of the centred window read out by the vertically cropped
+	 * drive modes, 0 for the full active area.
+	 */
+	u32 rows;
 };
 
 static const struct imx283_readout_mode imx283_readout_modes[] = {
 	/* All pixel scan modes */
 	[IMX283_MODE_0] = { 0x04, 0x03, 0x10, 0x00 }, /* 12 bit */
 	[IMX283_MODE_1] = { 0x04, 0x01, 0x00, 0x00 }, /* 10 bit */
-	[IMX283_MODE_1A] = { 0x04, 0x01, 0x20, 0x50 }, /* 10 bit */
-	[IMX283_MODE_1S] = { 0x04, 0x41, 0x20, 0x50 }, /* 10 bit */
+	[IMX283_MODE_1A] = { 0x04, 0x01, 0x20, 0x50, 3078 }, /* 10 bit */
+	[IMX283_MODE_1S] = { 0x04, 0x41, 0x20, 0x50, 3078 }, /* 10 bit */
 
 	/* Horizontal / Vertical 2/2-line binning */
 	[IMX283_MODE_2] = { 0x0d, 0x11, 0x50, 0x00 }, /* 12 bit */
-	[IMX283_MODE_2A] = { 0x0d, 0x11, 0x70, 0x50 }, /* 12 bit */
+	[IMX283_MODE_2A] = { 0x0d, 0x11, 0x70, 0x50, 3078 }, /* 12 bit */
 
 	/* Horizontal / Vertical 3/3-line binning */
 	[IMX283_MODE_3] = { 0x1e, 0x18, 0x10, 0x00 }, /* 12 bit */
@@ -355,8 +374,10 @@ static const struct imx283_readout_mode imx283_readout_modes[] = {
 };
 
 static const struct cci_reg_sequence mipi_data_rate_1440Mbps[] = {
-	/* The default register settings provide the 1440Mbps rate */
-#if 0
+	/*
+	 * These are the power on defaults, but must be restored explicitly
+	 * when switching back from the 720Mbps rate.
+	 */
 	{ CCI_REG8(0x36c5), 0x00 }, /* Undocumented */
 	{ CCI_REG8(0x3ac4), 0x00 }, /* Undocumented */
 
@@ -373,8 +394,6 @@ static const struct cci_reg_sequence mipi_data_rate_1440Mbps[] = {
 	{ CCI_REG8(0x3028), 0x47 }, /* THSEXIT */
 	{ CCI_REG8(0x302A), 0x07 }, /* TCKLPRE */
 	{ CCI_REG8(0x3104), 0x02 }, /* SYSMODE */
-
-#endif
 };
 
 static const struct cci_reg_sequence mipi_data_rate_720Mbps[] = {
@@ -402,6 +421,9 @@ static const s64 link_frequencies[] = {
 	MHZ(360), /* 720 Mbps data lane rate */
 };
 
+/* Index of the 720Mbps lane rate used by the low power clocking profile */
+#define IMX283_LINK_FREQ_LOW_POWER	1
+
 static const struct IMX283_reg_list link_freq_reglist[] = {
 	{ /* MHZ(720)*/
 		.num_of_regs = ARRAY_SIZE(mipi_data_rate_1440Mbps),
@@ -421,6 +443,45 @@ static const struct IMX283_reg_list link_freq_reglist[] = {
 		.height = (_height), \
 	}
 
+/*
+ * The windowed modes below have not been characterised on hardware. Their
+ * minimum VMAX is extrapolated as the lines read out for the window plus the
+ * readout overhead of the full size mode using the same drive mode, and their
+ * default VMAX is kept 20% above it, as for mode 1A.
+ */
+#define IMX283_MODE_1A_VMAX_OVERHEAD	(3203 - 3094)
+#define IMX283_MODE_2_VMAX_OVERHEAD	(3840 - 2 * 1828)
+
+#define IMX283_EXTRAPOLATED_MIN_VMAX(_lines, _overhead) \
+	((_lines) + (_overhead))
+#define IMX283_EXTRAPOLATED_DEFAULT_VMAX(_min_vmax) \
+	((_min_vmax) * 6 / 5)
+
+/*
+ * Line-scan windows of a few rows, centred in the active area and read out in
+ * the vertically cropped 1A drive mode. The vertical OB rows are not output,
+ * as they would outnumber the image rows.
+ */
+#define IMX283_LINESCAN_MIN_VMAX(_rows) \
+	IMX283_EXTRAPOLATED_MIN_VMAX(_rows, IMX283_MODE_1A_VMAX_OVERHEAD)
+
+#define LINESCAN_MODE(_rows) \
+	{ \
+		.mode = IMX283_MODE_1A, \
+		.bpp = 10, \
+		.width = 5472 + 96, \
+		.height = (_rows), \
+		.min_HMAX = 745, \
+		.min_VMAX = IMX283_LINESCAN_MIN_VMAX(_rows), \
+		.default_HMAX = 750, \
+		.default_VMAX = \
+			IMX283_EXTRAPOLATED_DEFAULT_VMAX(IMX283_LINESCAN_MIN_VMAX(_rows)), \
+		.min_SHR = 12, \
+		.horizontal_ob = 96, \
+		.vertical_ob = 0, \
+		.crop = CENTERED_RECTANGLE(imx283_active_area, 5472, (_rows)), \
+	}
+
 /* Mode configs */
 static const struct imx283_mode supported_modes_12bit[] = {
 	{
@@ -453,6 +514,28 @@ static const struct imx283_mode supported_modes_12bit[] = {
 		.vertical_ob = 8/2,
 		.crop = CENTERED_RECTANGLE(imx283_active_area, 5472, 3648),
 	},
+	{
+		/*
+		 * 1968x1084 84.56fps readout mode 2A
+		 * 1920x1080 window, binned from a 3840x2160 crop centred in
+		 * the 3078 rows read out by mode 2A.
+		 */
+		.mode = IMX283_MODE_2A,
+		.bpp = 12,
+		.width = (3840 + 96)/2,
+		.height = (2160 + 8)/2,
+		.min_HMAX = 362,
+		.min_VMAX = IMX283_EXTRAPOLATED_MIN_VMAX(2 * ((2160 + 8)/2),
+				IMX283_MODE_2_VMAX_OVERHEAD),
+		.default_HMAX = 375,
+		.default_VMAX = IMX283_EXTRAPOLATED_DEFAULT_VMAX(
+			IMX283_EXTRAPOLATED_MIN_VMAX(2 * ((2160 + 8)/2),
+				IMX283_MODE_2_VMAX_OVERHEAD)),
+		.min_SHR = 12,
+		.horizontal_ob = 96/2,
+		.vertical_ob = 8/2,
+		.crop = CENTERED_RECTANGLE(imx283_active_area, 3840, 2160),
+	},
 };
 
 static const struct imx283_mode supported_modes_10bit[] = {
@@ -486,6 +569,36 @@ static const struct imx283_mode supported_modes_10bit[] = {
 		.vertical_ob = 16,
 		.crop = CENTERED_RECTANGLE(imx283_active_area, 5472, 3078),
 	},
+	{
+		/*
+		 * 3936x2176 42.30fps readout mode 1A
+		 * 3840x2160 window centred in the 3078 rows read out by
+		 * mode 1A.
+		 */
+		.mode = IMX283_MODE_1A,
+		.bpp = 10,
+		.width = 3840 + 96,
+		.height = 2160 + 16,
+		.min_HMAX = 745,
+		.min_VMAX = IMX283_EXTRAPOLATED_MIN_VMAX(2160 + 16,
+				IMX283_MODE_1A_VMAX_OVERHEAD),
+		.default_HMAX = 750,
+		.default_VMAX = IMX283_EXTRAPOLATED_DEFAULT_VMAX(
+			IMX283_EXTRAPOLATED_MIN_VMAX(2160 + 16,
+				IMX283_MODE_1A_VMAX_OVERHEAD)),
+		.min_SHR = 12,
+		.horizontal_ob = 96,
+		.vertical_ob = 16,
+		.crop = CENTERED_RECTANGLE(imx283_active_area, 3840, 2160),
+	},
+	/* 5568x64 558.64fps line-scan window */
+	LINESCAN_MODE(64),
+	/* 5568x32 685.42fps line-scan window */
+	LINESCAN_MODE(32),
+	/* 5568x16 773.15fps line-scan window */
+	LINESCAN_MODE(16),
+	/* 5568x8 826.02fps line-scan window */
+	LINESCAN_MODE(8),
 };
 
 /*
@@ -531,6 +644,48 @@ static const char * const imx283_supply_name[] = {
 #define imx283_XCLR_MIN_DELAY_US	100000
 #define imx283_XCLR_DELAY_RANGE_US	1000
 
+/* Origin of CCI transactions, for bus time accounting */
+enum imx283_cci_tag {
+	IMX283_CCI_TAG_OTHER,
+	IMX283_CCI_TAG_PROBE,
+	IMX283_CCI_TAG_PLL,
+	IMX283_CCI_TAG_MODE,
+	IMX283_CCI_TAG_STREAM_ON,
+	IMX283_CCI_TAG_STREAM_OFF,
+	IMX283_CCI_TAG_EXPOSURE,
+	IMX283_CCI_TAG_HBLANK,
+	IMX283_CCI_TAG_VBLANK,
+	IMX283_CCI_TAG_ANALOGUE_GAIN,
+	IMX283_CCI_TAG_DIGITAL_GAIN,
+	IMX283_CCI_TAG_TEST_PATTERN,
+	IMX283_CCI_TAG_BURST,
+	IMX283_CCI_TAG_DEBUGFS,
+	IMX283_CCI_NUM_TAGS,
+};
+
+static const char * const imx283_cci_tag_names[] = {
+	[IMX283_CCI_TAG_OTHER] = "other",
+	[IMX283_CCI_TAG_PROBE] = "probe",
+	[IMX283_CCI_TAG_PLL] = "pll",
+	[IMX283_CCI_TAG_MODE] = "mode",
+	[IMX283_CCI_TAG_STREAM_ON] = "stream_on",
+	[IMX283_CCI_TAG_STREAM_OFF] = "stream_off",
+	[IMX283_CCI_TAG_EXPOSURE] = "exposure",
+	[IMX283_CCI_TAG_HBLANK] = "hblank",
+	[IMX283_CCI_TAG_VBLANK] = "vblank",
+	[IMX283_CCI_TAG_ANALOGUE_GAIN] = "analogue_gain",
+	[IMX283_CCI_TAG_DIGITAL_GAIN] = "digital_gain",
+	[IMX283_CCI_TAG_TEST_PATTERN] = "test_pattern",
+	[IMX283_CCI_TAG_BURST] = "burst",
+	[IMX283_CCI_TAG_DEBUGFS] = "debugfs",
+};
+
+struct imx283_cci_stats {
+	u64 transfers;
+	u64 bytes;
+	u64 time_ns;
+};
+
 struct imx283 {
 	struct device *dev;
 
@@ -539,6 +694,10 @@ struct imx283 {
 	/* Selected link_frequency */
 	unsigned int link_freq_idx;
 
+	/* Fastest link frequency and all those allowed by the endpoint */
+	unsigned int default_link_freq_idx;
+	unsigned long link_freq_bitmap;
+
 	struct v4l2_subdev sd;
 	struct media_pad pad;
 
@@ -558,6 +717,9 @@ struct imx283 {
 	struct v4l2_ctrl *hflip;
 	struct v4l2_ctrl *vblank;
 	struct v4l2_ctrl *hblank;
+	struct v4l2_ctrl *burst_frames;
+	struct v4l2_ctrl *low_power;
+	struct v4l2_ctrl *min_skew;
 
 	/* Current mode */
 	const struct imx283_mode *mode;
@@ -565,6 +727,12 @@ struct imx283 {
 	u16 hmax;
 	u32 vmax;
 
+	/* Frame interval requested by the client, 0/0 if none */
+	struct v4l2_fract frame_interval;
+
+	/* Link re-selection suppressed, see imx283_update_link() */
+	bool link_updating;
+
 	/*
 	 * Mutex for serialized access:
 	 * Protect sensor module set pad format and start/stop streaming safely.
@@ -573,10 +741,67 @@ struct imx283 {
 
 	/* Streaming on/off */
 	bool streaming;
+
+	/* Time at which the sensor started outputting frames */
+	ktime_t stream_start;
+
+	/*
+	 * Burst capture: the timer first fires in the frame before the last
+	 * one to lengthen the latter, then in its blanking to put the sensor
+	 * in standby. Both writes are deferred to burst_work, as I2C can't be
+	 * used from hrtimer context. burst_deadline is the expiry of the armed
+	 * timer, and tells apart work left over from a stopped stream.
+	 */
+	struct hrtimer burst_timer;
+	struct work_struct burst_work;
+	bool burst_armed;
+	bool burst_extended;
+	ktime_t burst_deadline;
+	ktime_t burst_standby;
+
+	/* In logic standby at the end of a burst, ready for a trigger */
+	bool burst_in_standby;
+
+	/* User settings, restored once the burst no longer needs the minimum */
+	s32 burst_saved_vblank;
+	s32 burst_saved_exposure;
+	bool burst_vblank_saved;
+
+	struct dentry *debugfs;
+
+	/* Bus usage per originating control or phase */
+	enum imx283_cci_tag cci_tag;
+	struct imx283_cci_stats cci_stats[IMX283_CCI_NUM_TAGS];
 };
 
+/* Attribute the following transactions to a tag, returning the previous one */
+static enum imx283_cci_tag imx283_cci_set_tag(struct imx283 *imx283,
+					      enum imx283_cci_tag tag)
+{
+	enum imx283_cci_tag prev = imx283->cci_tag;
+
+	imx283->cci_tag = tag;
 
+	return prev;
+}
+
+static void imx283_cci_account(struct imx283 *imx283, unsigned int bytes,
+			       ktime_t start)
+{
+	struct imx283_cci_stats *stats = &imx283->cci_stats[imx283->cci_tag];
 
+	stats->transfers++;
+	stats->bytes += bytes;
+	stats->time_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+
+/*
+ * Every register transaction is traced with dev_dbg() as
+ *   cci <r|w> <address>: <data bytes in bus order>
+ * so that a session's exact I2C sequence can be captured through dynamic
+ * debug, e.g. echo 'file imx283.c +pt' > /sys/kernel/debug/dynamic_debug/control
+ */
 int cci_read(struct imx283 *imx283, u32 reg, u64 *val, int *err) {
     if (err && *err)
         return *err;
@@ -587,6 +812,7 @@ int cci_read(struct imx283 *imx283, u32 reg, u64 *val, int *err) {
     u8 addr_buf[2] = { reg_addr >> 8, reg_addr & 0xff };
     u8 data_buf[8] = { 0 };  // Max 8 bytes for 64-bit data
     struct i2c_msg msgs[2];
+    ktime_t start;
     int ret;
 
     if (width == 0 || width > 8) {
@@ -606,12 +832,17 @@ int cci_read(struct imx283 *imx283, u32 reg, u64 *val, int *err) {
     msgs[1].len = width;
     msgs[1].buf = data_buf;
 
+    start = ktime_get();
     ret = i2c_transfer(client->adapter, msgs, 2);
+    imx283_cci_account(imx283, sizeof(addr_buf) + width, start);
     if (ret != 2) {
+        dev_dbg(imx283->dev, "cci r %04x: failed %d\n", reg_addr, ret);
         if (err) *err = -EIO;
         return -EIO;
     }
 
+    dev_dbg(imx283->dev, "cci r %04x: %*phN\n", reg_addr, width, data_buf);
+
     // Assuming big-endian register format
     *val = 0;
     for (int i = 0; i < width; i++) {
@@ -629,6 +860,7 @@ int cci_write(struct imx283 *imx283, u32 reg, u64 val, int *err) {
     u32 width = (reg & CCI_REG_WIDTH_MASK) >> CCI_REG_WIDTH_SHIFT;
     bool is_le = reg & CCI_REG_LE;
     u8 buf[10]; // Maximum size needed: 2 bytes for address + 8 bytes for data
+    ktime_t start;
     int ret, i;
 
     // Set the register address (big-endian)
@@ -646,12 +878,17 @@ int cci_write(struct imx283 *imx283, u32 reg, u64 val, int *err) {
         }
     }
 
+    start = ktime_get();
     ret = i2c_master_send(client, buf, 2 + width);
+    imx283_cci_account(imx283, 2 + width, start);
     if (ret < 0) {
+        dev_dbg(imx283->dev, "cci w %04x: failed %d\n", reg_addr, ret);
         if (err) *err = ret;
         return ret;
     }
 
+    dev_dbg(imx283->dev, "cci w %04x: %*phN\n", reg_addr, width, &buf[2]);
+
     return 0;
 }
 
@@ -825,12 +1062,352 @@ static int imx283_update_test_pattern(struct imx283 *imx283, u32 pattern_index)
 	return ret;
 }
 
+static u64 imx283_fract_to_ns(const struct v4l2_fract *fi)
+{
+	return div_u64((u64)fi->numerator * NSEC_PER_SEC, fi->denominator);
+}
+
+/* HMAX is expressed in cycles of the 72MHz internal clock */
+static u64 imx283_lines_to_ns(struct imx283 *imx283, u64 lines)
+{
+	return div_u64(lines * imx283->hmax * 1000, 72);
+}
+
+static u64 imx283_frame_period_ns(struct imx283 *imx283)
+{
+	return imx283_lines_to_ns(imx283, imx283->vmax);
+}
+
+/* Number of HMAX periods spent reading out each output row */
+static unsigned int imx283_lines_per_row(const struct imx283_mode *mode)
+{
+	switch (mode->mode) {
+	case IMX283_MODE_2:
+	case IMX283_MODE_2A:
+		return 2;
+	case IMX283_MODE_3:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+/*
+ * Shortest HMAX sustainable by both the readout and the MIPI link, which
+ * must transfer a row over 4 lanes within the HMAX periods spent on it.
+ */
+static u64 imx283_min_hmax(const struct imx283_mode *mode,
+			   unsigned int link_freq_idx)
+{
+	u64 lane_mbps = div_u64(link_frequencies[link_freq_idx] * 2, MHZ(1));
+	u64 link_hmax;
+
+	link_hmax = DIV_ROUND_UP_ULL((u64)mode->width * mode->bpp * 72,
+				     4 * lane_mbps * imx283_lines_per_row(mode));
+
+	return max_t(u64, mode->min_HMAX, link_hmax);
+}
+
+/* HBLANK giving at least the requested HMAX at the mode's pixel rate */
+static u64 imx283_hmax_to_hblank(const struct imx283_mode *mode, u64 hmax)
+{
+	return DIV_ROUND_UP_ULL(hmax * mode->width, mode->min_HMAX) - mode->width;
+}
+
+/*
+ * With the low power profile enabled, use the 720Mbps link whenever the
+ * requested frame interval (or the current one if none was requested) can be
+ * met with the longer HMAX it needs. Returns true if the link changed.
+ */
+static bool imx283_select_link_freq(struct imx283 *imx283)
+{
+	const struct imx283_mode *mode = imx283->mode;
+	const struct v4l2_fract *fi = &imx283->frame_interval;
+	unsigned int idx = imx283->default_link_freq_idx;
+	u64 interval_ns, lp_interval_ns;
+
+	/* The link can't change under an active stream */
+	if (imx283->streaming)
+		return false;
+
+	/* The longer line of the slow link would increase the skew */
+	if (imx283->low_power->val && !imx283->min_skew->val &&
+	    test_bit(IMX283_LINK_FREQ_LOW_POWER, &imx283->link_freq_bitmap)) {
+		if (fi->numerator && fi->denominator)
+			interval_ns = imx283_fract_to_ns(fi);
+		else
+			interval_ns = imx283_frame_period_ns(imx283);
+
+		lp_interval_ns = div_u64(imx283_min_hmax(mode,
+					 IMX283_LINK_FREQ_LOW_POWER) *
+					 mode->min_VMAX * 1000, 72);
+		if (interval_ns >= lp_interval_ns)
+			idx = IMX283_LINK_FREQ_LOW_POWER;
+	}
+
+	if (idx == imx283->link_freq_idx)
+		return false;
+
+	dev_info(imx283->dev, "Switching to %u Mbps link\n",
+		 (u32)div_s64(link_frequencies[idx], 500000));
+
+	imx283->link_freq_idx = idx;
+	__v4l2_ctrl_s_ctrl(imx283->link_freq, idx);
+
+	return true;
+}
+
+/*
+ * Bursts always run at the maximum frame rate of the mode. The shorter frame
+ * narrows the exposure range, so the exposure is saved along with VBLANK.
+ * The burst VBLANK is temporary, so it must not re-select the link, which
+ * the VBLANK control otherwise does while stopped.
+ */
+static void imx283_burst_set_vblank(struct imx283 *imx283)
+{
+	const struct imx283_mode *mode = imx283->mode;
+
+	if (!imx283->burst_vblank_saved) {
+		imx283->burst_saved_vblank = imx283->vblank->val;
+		imx283->burst_saved_exposure = imx283->exposure->val;
+		imx283->burst_vblank_saved = true;
+	}
+
+	imx283->link_updating = true;
+	__v4l2_ctrl_s_ctrl(imx283->vblank, mode->min_VMAX - mode->height);
+	imx283->link_updating = false;
+}
+
+static void imx283_burst_restore_vblank(struct imx283 *imx283)
+{
+	if (!imx283->burst_vblank_saved)
+		return;
+
+	imx283->burst_vblank_saved = false;
+	imx283->link_updating = true;
+	__v4l2_ctrl_s_ctrl(imx283->vblank, imx283->burst_saved_vblank);
+	imx283->link_updating = false;
+	__v4l2_ctrl_s_ctrl(imx283->exposure, imx283->burst_saved_exposure);
+}
+
+/*
+ * Program the burst frame length, optionally lengthened by twice the slack
+ * so standby can be entered in the blanking of the last frame. SHR is
+ * relative to VMAX, so it is rewritten to keep the exposure unchanged.
+ */
+static int imx283_burst_write_vmax(struct imx283 *imx283, bool extend)
+{
+	u64 vmax = imx283->vmax;
+	u64 shr;
+	int ret = 0;
+
+	if (extend) {
+		vmax += div_u64(2 * IMX283_BURST_SLACK_NS * 72,
+				imx283->hmax * 1000);
+		vmax = min_t(u64, vmax, IMX283_VMAX_MAX);
+	}
+
+	shr = calculate_shr(imx283->exposure->val, imx283->hmax, vmax, 0, 209);
+	cci_write(imx283, IMX283_REG_VMAX, vmax, &ret);
+	cci_write(imx283, IMX283_REG_SHR, shr, &ret);
+	if (!ret)
+		imx283->burst_extended = extend;
+
+	return ret;
+}
+
+/*
+ * Arm the burst timer. A new VMAX applies from the frame after the one in
+ * progress, so the last frame is lengthened from a quarter of the way into
+ * the frame before it. That leaves most of a frame for the timer, work and
+ * I2C latency. Standby is then entered one slack after the last frame would
+ * have ended at the burst VMAX, and one slack before its lengthened end. This
+ * doesn't depend on where in the frame the rows are output.
+ */
+static void imx283_burst_arm(struct imx283 *imx283)
+{
+	u32 frames = imx283->burst_frames->val;
+	u64 period = imx283_frame_period_ns(imx283);
+
+	imx283->burst_standby = ktime_add_ns(imx283->stream_start,
+					     frames * period +
+					     IMX283_BURST_SLACK_NS);
+
+	if (imx283->burst_extended)
+		imx283->burst_deadline = imx283->burst_standby;
+	else
+		imx283->burst_deadline = ktime_add_ns(imx283->stream_start,
+						      (frames - 2) * period +
+						      period / 4);
+
+	imx283->burst_armed = true;
+	hrtimer_start(&imx283->burst_timer, imx283->burst_deadline,
+		      HRTIMER_MODE_ABS);
+}
+
+/*
+ * Restart a burst from logic standby. The PLL, link and readout mode are
+ * retained in logic standby, so only the standby release and its
+ * stabilisation period are needed.
+ */
+static int imx283_burst_trigger(struct imx283 *imx283)
+{
+	u32 frames = imx283->burst_frames->val;
+	int ret;
+
+	if (!imx283->streaming || !imx283->burst_in_standby || !frames)
+		return -EBUSY;
+
+	imx283_burst_set_vblank(imx283);
+
+	/* VMAX may still hold the lengthened last frame of the previous burst */
+	ret = imx283_burst_write_vmax(imx283, frames == 1);
+	if (ret)
+		return ret;
+
+	ret = cci_write(imx283, IMX283_REG_STANDBY, IMX283_ACTIVE, NULL);
+	if (ret)
+		return ret;
+
+	imx283->burst_in_standby = false;
+
+	usleep_range(19000, 20000); /* 2nd Stabilisation period of 19ms or more */
+
+	imx283->stream_start = ktime_get();
+	imx283_burst_arm(imx283);
+
+	return 0;
+}
+
+/* Exposure limits depend on both HMAX and VMAX */
+static void imx283_update_exposure_range(struct imx283 *imx283)
+{
+	u64 current_exposure, max_exposure, min_exposure;
+
+	calculate_min_max_v4l2_cid_exposure(imx283->hmax, imx283->vmax,
+					    (u64)imx283->mode->min_SHR, 0, 209,
+					    &min_exposure, &max_exposure);
+
+	current_exposure = clamp_t(u64, imx283->exposure->val,
+				   min_exposure, max_exposure);
+
+	dev_info(imx283->dev,"exposure_max:%lld, exposure_min:%lld, current_exposure:%lld\n",max_exposure, min_exposure, current_exposure);
+	dev_info(imx283->dev, "\tVMAX:%d, HMAX:%d\n", imx283->vmax, imx283->hmax);
+	__v4l2_ctrl_modify_range(imx283->exposure, min_exposure,max_exposure, 1,current_exposure);
+}
+
+/*
+ * The HBLANK range starts at the shortest line the mode and link allow. In
+ * skew minimisation mode HBLANK is pinned there, and the frame rate is
+ * only adjusted through VBLANK.
+ */
+static void imx283_set_hblank_limits(struct imx283 *imx283)
+{
+	const struct imx283_mode *mode = imx283->mode;
+	u64 def_hblank, min_hblank;
+	u64 pixel_rate, min_hmax;
+
+	pixel_rate = (u64)mode->width * 72000000;
+	do_div(pixel_rate,mode->min_HMAX);
+
+	//int def_hblank = mode->default_HMAX * IMX283_PIXEL_RATE / 72000000 - IMX283_NATIVE_WIDTH;
+	def_hblank = mode->default_HMAX * pixel_rate;
+	do_div(def_hblank, 72000000);
+	def_hblank = def_hblank - mode->width;
+
+	/* The slower link needs a longer line, run at its minimum */
+	min_hmax = imx283_min_hmax(mode, imx283->link_freq_idx);
+	min_hblank = imx283_hmax_to_hblank(mode, min_hmax);
+	if (imx283->link_freq_idx != imx283->default_link_freq_idx)
+		def_hblank = min_hblank;
+	def_hblank = max(def_hblank, min_hblank);
+
+	if (imx283->min_skew->val) {
+		__v4l2_ctrl_modify_range(imx283->hblank, min_hblank,
+					 min_hblank, 1, min_hblank);
+		def_hblank = min_hblank;
+	} else {
+		__v4l2_ctrl_modify_range(imx283->hblank, min_hblank,
+					 IMX283_HMAX_MAX, 1, def_hblank);
+	}
+	__v4l2_ctrl_s_ctrl(imx283->hblank, def_hblank);
+
+	dev_info(imx283->dev, "Setting default HBLANK : %lld\n", def_hblank);
+}
+
+/* VMAX for a frame length as close as possible to interval_ns */
+static u32 imx283_interval_to_vmax(struct imx283 *imx283, u64 interval_ns)
+{
+	u64 vmax;
+
+	vmax = div64_u64(interval_ns * 72, (u64)imx283->hmax * 1000);
+
+	return clamp_t(u64, vmax, imx283->mode->min_VMAX, IMX283_VMAX_MAX);
+}
+
+/* Set VBLANK for a frame length as close as possible to interval_ns */
+static void imx283_set_frame_length_ns(struct imx283 *imx283, u64 interval_ns)
+{
+	const struct imx283_mode *mode = imx283->mode;
+
+	__v4l2_ctrl_s_ctrl(imx283->vblank,
+			   imx283_interval_to_vmax(imx283, interval_ns) -
+			   mode->height);
+}
+
+/*
+ * Re-select the link while stopped, and keep the current frame interval
+ * through VBLANK on the line length the link and skew mode allow. The
+ * VBLANK control re-selects the link too, which is skipped while the link
+ * is being updated here. Returns true if the link changed.
+ */
+static bool imx283_update_link(struct imx283 *imx283, bool reset_hblank)
+{
+	u64 interval_ns = imx283_frame_period_ns(imx283);
+	bool changed;
+
+	changed = imx283_select_link_freq(imx283);
+	if (!changed && !reset_hblank)
+		return false;
+
+	imx283->link_updating = true;
+	imx283_set_hblank_limits(imx283);
+	imx283_set_frame_length_ns(imx283, interval_ns);
+	imx283->link_updating = false;
+
+	return changed;
+}
+
+static enum imx283_cci_tag imx283_ctrl_cci_tag(u32 id)
+{
+	switch (id) {
+	case V4L2_CID_EXPOSURE:
+		return IMX283_CCI_TAG_EXPOSURE;
+	case V4L2_CID_HBLANK:
+		return IMX283_CCI_TAG_HBLANK;
+	case V4L2_CID_VBLANK:
+		return IMX283_CCI_TAG_VBLANK;
+	case V4L2_CID_ANALOGUE_GAIN:
+		return IMX283_CCI_TAG_ANALOGUE_GAIN;
+	case V4L2_CID_DIGITAL_GAIN:
+		return IMX283_CCI_TAG_DIGITAL_GAIN;
+	case V4L2_CID_TEST_PATTERN:
+		return IMX283_CCI_TAG_TEST_PATTERN;
+	case V4L2_CID_IMX283_BURST_TRIGGER:
+		return IMX283_CCI_TAG_BURST;
+	default:
+		return IMX283_CCI_TAG_OTHER;
+	}
+}
+
 static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 {
 	struct imx283 *imx283 =
 		container_of(ctrl->handler, struct imx283, ctrl_handler);
 	const struct imx283_mode *mode = imx283->mode;
 	u64 shr, pixel_rate, hmax = 0;
+	enum imx283_cci_tag prev_tag;
+	u64 interval_ns;
 	int ret = 0;
 
 	//state = v4l2_subdev_get_locked_active_state(&imx283->sd);
@@ -842,19 +1419,56 @@ static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 	 */
 	if (ctrl->id == V4L2_CID_VBLANK){
 		/* Honour the VBLANK limits when setting exposure. */
-		u64 current_exposure, max_exposure, min_exposure, vmax;
-		vmax = ((u64)mode->height + ctrl->val) ;
-		imx283->vmax = vmax;
+		imx283->vmax = ((u64)mode->height + ctrl->val) ;
 
-		calculate_min_max_v4l2_cid_exposure(imx283->hmax, imx283->vmax,
-						    (u64)mode->min_SHR, 0, 209,
-						    &min_exposure, &max_exposure);
+		/*
+		 * While stopped, the new frame length may suit the other link.
+		 * Keep it on the line length of that link.
+		 */
+		if (!imx283->streaming && !imx283->link_updating) {
+			interval_ns = imx283_frame_period_ns(imx283);
+			if (imx283_select_link_freq(imx283)) {
+				imx283->link_updating = true;
+				imx283_set_hblank_limits(imx283);
+				imx283->link_updating = false;
+				imx283->vmax = imx283_interval_to_vmax(imx283,
+								       interval_ns);
+				ctrl->val = imx283->vmax - mode->height;
+			}
+		}
 
-		current_exposure = clamp_t(uint32_t, current_exposure, min_exposure, max_exposure);
+		imx283_update_exposure_range(imx283);
+	}
 
-		dev_info(imx283->dev,"exposure_max:%lld, exposure_min:%lld, current_exposure:%lld\n",max_exposure, min_exposure, current_exposure);
-		dev_info(imx283->dev, "\tVMAX:%d, HMAX:%d\n", imx283->vmax, imx283->hmax);
-		__v4l2_ctrl_modify_range(imx283->exposure, min_exposure,max_exposure, 1,current_exposure);
+	/*
+	 * Pin HBLANK to its minimum, or release it, keeping the frame
+	 * interval unchanged through VBLANK.
+	 */
+	if (ctrl->id == V4L2_CID_IMX283_MIN_SKEW) {
+		if (ctrl->val != ctrl->cur.val)
+			imx283_update_link(imx283, true);
+		return 0;
+	}
+
+	/* Re-evaluate the link, keeping the current frame interval */
+	if (ctrl->id == V4L2_CID_IMX283_LOW_POWER) {
+		if (ctrl->val != ctrl->cur.val)
+			imx283_update_link(imx283, false);
+		return 0;
+	}
+
+	/*
+	 * Track HMAX even while powered down, as the frame interval
+	 * calculations depend on it.
+	 */
+	if (ctrl->id == V4L2_CID_HBLANK) {
+		//int hmax = (IMX283_NATIVE_WIDTH + ctrl->val) * 72000000; / IMX283_PIXEL_RATE;
+		pixel_rate = (u64)mode->width * 72000000;
+		do_div(pixel_rate, mode->min_HMAX);
+		hmax = (u64)(mode->width + ctrl->val) * 72000000;
+		do_div(hmax, pixel_rate);
+		imx283->hmax = hmax;
+		imx283_update_exposure_range(imx283);
 	}
 
 	/*
@@ -864,7 +1478,8 @@ static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 	if (pm_runtime_get_if_in_use(imx283->dev) == 0)
 		return 0;
 
-	
+	prev_tag = imx283_cci_set_tag(imx283, imx283_ctrl_cci_tag(ctrl->id));
+
 	switch (ctrl->id) {
 	case V4L2_CID_EXPOSURE:
 		{
@@ -881,14 +1496,8 @@ static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 	case V4L2_CID_HBLANK:
 		{
 		dev_info(imx283->dev, "V4L2_CID_HBLANK : %d\n", ctrl->val);
-		//int hmax = (IMX283_NATIVE_WIDTH + ctrl->val) * 72000000; / IMX283_PIXEL_RATE;
-		pixel_rate = (u64)mode->width * 72000000;
-		do_div(pixel_rate, mode->min_HMAX);
-		hmax = (u64)(mode->width + ctrl->val) * 72000000;
-		do_div(hmax, pixel_rate);
-		imx283->hmax = hmax;
 		dev_info(imx283->dev, "\tHMAX : %d\n", imx283->hmax);
-		ret = cci_write(imx283, IMX283_REG_HMAX, hmax, NULL);
+		ret = cci_write(imx283, IMX283_REG_HMAX, imx283->hmax, NULL);
 		}
 		break;
 
@@ -922,6 +1531,18 @@ static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 		ret = imx283_update_test_pattern(imx283, ctrl->val);
 		break;
 
+	case V4L2_CID_IMX283_BURST_FRAMES:
+		/* Takes effect at the next stream start or trigger */
+		break;
+
+	case V4L2_CID_LINK_FREQ:
+		/* Programmed when cancelling standby */
+		break;
+
+	case V4L2_CID_IMX283_BURST_TRIGGER:
+		ret = imx283_burst_trigger(imx283);
+		break;
+
 	default:
 		dev_info(imx283->dev,
 			 "ctrl(id:0x%x,val:0x%x) is not handled\n",
@@ -930,6 +1551,8 @@ static int imx283_set_ctrl(struct v4l2_ctrl *ctrl)
 		break;
 	}
 
+	imx283_cci_set_tag(imx283, prev_tag);
+
 	pm_runtime_put(imx283->dev);
 
 	return ret;
@@ -939,6 +1562,61 @@ static const struct v4l2_ctrl_ops imx283_ctrl_ops = {
 	.s_ctrl = imx283_set_ctrl,
 };
 
+/*
+ * Number of frames to capture at the mode's minimum VMAX before the sensor
+ * drops back to logic standby. 0 streams continuously.
+ */
+static const struct v4l2_ctrl_config imx283_burst_frames_ctrl = {
+	.ops = &imx283_ctrl_ops,
+	.id = V4L2_CID_IMX283_BURST_FRAMES,
+	.name = "Burst Frames",
+	.type = V4L2_CTRL_TYPE_INTEGER,
+	.min = 0,
+	.max = 0xffff,
+	.step = 1,
+	.def = 0,
+};
+
+/*
+ * Drop to the 720Mbps link, with HMAX lengthened to match, whenever the
+ * frame interval leaves enough time for it.
+ */
+static const struct v4l2_ctrl_config imx283_low_power_ctrl = {
+	.ops = &imx283_ctrl_ops,
+	.id = V4L2_CID_IMX283_LOW_POWER,
+	.name = "Low Power Clocking",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 0,
+};
+
+/*
+ * Keep HMAX at the shortest line the bit depth, link and mode allow, so
+ * rows are read out as close together as possible, and meet frame rate
+ * targets through VMAX only.
+ */
+static const struct v4l2_ctrl_config imx283_min_skew_ctrl = {
+	.ops = &imx283_ctrl_ops,
+	.id = V4L2_CID_IMX283_MIN_SKEW,
+	.name = "Minimise Rolling Shutter Skew",
+	.type = V4L2_CTRL_TYPE_BOOLEAN,
+	.min = 0,
+	.max = 1,
+	.step = 1,
+	.def = 0,
+};
+
+/* Capture another burst once the previous one has completed */
+static const struct v4l2_ctrl_config imx283_burst_trigger_ctrl = {
+	.ops = &imx283_ctrl_ops,
+	.id = V4L2_CID_IMX283_BURST_TRIGGER,
+	.name = "Burst Trigger",
+	.type = V4L2_CTRL_TYPE_BUTTON,
+	.flags = V4L2_CTRL_FLAG_WRITE_ONLY | V4L2_CTRL_FLAG_EXECUTE_ON_WRITE,
+};
+
 static int imx283_enum_mbus_code(struct v4l2_subdev *sd,
 				 struct v4l2_subdev_state *sd_state,
 				 struct v4l2_subdev_mbus_code_enum *code)
@@ -960,22 +1638,79 @@ static int imx283_enum_frame_size(struct v4l2_subdev *sd,
 	struct imx283 *imx283 = to_imx283(sd);
 
 	const struct imx283_mode *mode_list;
-	unsigned int num_modes;
+	unsigned int num_modes;
+
+	get_mode_table(fse->code, &mode_list, &num_modes);
+
+	if (fse->index >= num_modes)
+		return -EINVAL;
+
+	if (fse->code != imx283_get_format_code(imx283, fse->code))
+		return -EINVAL;
+
+	fse->min_width = mode_list[fse->index].width;
+	fse->max_width = fse->min_width;
+	fse->min_height = mode_list[fse->index].height;
+	fse->max_height = fse->min_height;
+
+	return 0;
+}
+
+/* Shortest frame interval a mode can achieve, in nanoseconds */
+static u64 imx283_mode_min_interval_ns(const struct imx283_mode *mode)
+{
+	return div_u64(mode->min_HMAX * mode->min_VMAX * 1000, 72);
+}
+
+/* Common frame intervals reported after the shortest one of a mode */
+static const struct v4l2_fract imx283_std_intervals[] = {
+	{ 1, 120 }, { 1, 60 }, { 1, 50 }, { 1, 30 }, { 1, 25 },
+	{ 1, 24 }, { 1, 15 }, { 1, 10 }, { 1, 5 }, { 1, 1 },
+};
+
+/*
+ * Index 0 is the shortest interval of the mode, followed by the common
+ * intervals longer than it. Any interval in between can be requested
+ * through s_frame_interval, as VBLANK is continuous.
+ */
+static int imx283_enum_frame_interval(struct v4l2_subdev *sd,
+				      struct v4l2_subdev_state *sd_state,
+				      struct v4l2_subdev_frame_interval_enum *fie)
+{
+	const struct imx283_mode *mode_list;
+	unsigned int num_modes, index, i;
+	u64 min_ns;
 
-	get_mode_table(fse->code, &mode_list, &num_modes);
+	get_mode_table(fie->code, &mode_list, &num_modes);
 
-	if (fse->index >= num_modes)
-		return -EINVAL;
+	for (i = 0; i < num_modes; i++)
+		if (mode_list[i].width == fie->width &&
+		    mode_list[i].height == fie->height)
+			break;
 
-	if (fse->code != imx283_get_format_code(imx283, fse->code))
+	if (i == num_modes)
 		return -EINVAL;
 
-	fse->min_width = mode_list[fse->index].width;
-	fse->max_width = fse->min_width;
-	fse->min_height = mode_list[fse->index].height;
-	fse->max_height = fse->min_height;
+	min_ns = imx283_mode_min_interval_ns(&mode_list[i]);
 
-	return 0;
+	if (!fie->index) {
+		fie->interval.numerator = div_u64(min_ns, NSEC_PER_USEC);
+		fie->interval.denominator = USEC_PER_SEC;
+		return 0;
+	}
+
+	index = 0;
+	for (i = 0; i < ARRAY_SIZE(imx283_std_intervals); i++) {
+		if (imx283_fract_to_ns(&imx283_std_intervals[i]) <= min_ns)
+			continue;
+
+		if (++index == fie->index) {
+			fie->interval = imx283_std_intervals[i];
+			return 0;
+		}
+	}
+
+	return -EINVAL;
 }
 
 static void imx283_reset_colorspace(struct v4l2_mbus_framefmt *fmt)
@@ -1022,29 +1757,118 @@ static int imx283_get_pad_format(struct v4l2_subdev *sd,
 	return 0;
 }
 
+/* Equivalent media bus code with the same bayer order at another bit depth */
+static u32 imx283_code_for_bpp(u32 code, unsigned int bpp)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(codes); i++)
+		if (codes[i] == code)
+			break;
+
+	if (i == ARRAY_SIZE(codes))
+		return code;
+
+	return codes[(bpp == 12 ? 0 : 4) + i % 4];
+}
+
+/*
+ * Cheapest mode of the bit depth of code, in bits per frame, that covers the
+ * requested size and can run at the requested frame interval.
+ */
+static const struct imx283_mode *
+imx283_find_mode_in_depth(u32 code, u32 width, u32 height, u64 interval_ns)
+{
+	const struct imx283_mode *mode_list, *best = NULL;
+	u64 best_cost = U64_MAX;
+	unsigned int num_modes, i;
+
+	get_mode_table(code, &mode_list, &num_modes);
+
+	for (i = 0; i < num_modes; i++) {
+		const struct imx283_mode *mode = &mode_list[i];
+		u64 cost = (u64)mode->width * mode->height * mode->bpp;
+
+		if (mode->width < width || mode->height < height)
+			continue;
+
+		if (imx283_mode_min_interval_ns(mode) > interval_ns)
+			continue;
+
+		if (cost < best_cost) {
+			best = mode;
+			best_cost = cost;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Pick a mode of the requested bit depth satisfying both the size and the
+ * frame interval, and only fall back to the other bit depth when none does,
+ * updating code to match. Returns NULL if no mode satisfies both.
+ */
+static const struct imx283_mode *
+imx283_find_mode_for_interval(u32 *code, u32 width, u32 height,
+			      const struct v4l2_fract *fi)
+{
+	u64 interval_ns = imx283_fract_to_ns(fi);
+	const struct imx283_mode *mode;
+	u32 other_code;
+
+	mode = imx283_find_mode_in_depth(*code, width, height, interval_ns);
+	if (mode)
+		return mode;
+
+	other_code = imx283_code_for_bpp(*code, 12);
+	if (other_code == *code)
+		other_code = imx283_code_for_bpp(*code, 10);
+
+	mode = imx283_find_mode_in_depth(other_code, width, height,
+					 interval_ns);
+	if (mode)
+		*code = other_code;
+
+	return mode;
+}
+
+/* Report the frame interval resulting from the current HMAX and VMAX */
+static void imx283_get_achieved_interval(struct imx283 *imx283,
+					 struct v4l2_fract *fi)
+{
+	fi->numerator = div_u64((u64)imx283->hmax * imx283->vmax, 72);
+	fi->denominator = USEC_PER_SEC;
+}
+
+/* Adjust VBLANK to get as close as possible to the requested interval */
+static void imx283_apply_frame_interval(struct imx283 *imx283)
+{
+	const struct v4l2_fract *fi = &imx283->frame_interval;
+
+	if (!fi->numerator || !fi->denominator)
+		return;
+
+	imx283_set_frame_length_ns(imx283, imx283_fract_to_ns(fi));
+}
+
 /* TODO */
 static void imx283_set_framing_limits(struct imx283 *imx283)
 {
 	const struct imx283_mode *mode = imx283->mode;
-	u64 def_hblank;
 	u64 pixel_rate;
 
 
 	imx283->vmax = mode->default_VMAX;
 	imx283->hmax = mode->default_HMAX;
 
+	imx283_select_link_freq(imx283);
+
 	pixel_rate = (u64)mode->width * 72000000;
 	do_div(pixel_rate,mode->min_HMAX);
 	dev_info(imx283->dev,"Pixel Rate : %lld\n",pixel_rate);
 
-
-	//int def_hblank = mode->default_HMAX * IMX283_PIXEL_RATE / 72000000 - IMX283_NATIVE_WIDTH;
-	def_hblank = mode->default_HMAX * pixel_rate;
-	do_div(def_hblank, 72000000);
-	def_hblank = def_hblank - mode->width;
-	__v4l2_ctrl_modify_range(imx283->hblank, 0,
-				 IMX283_HMAX_MAX, 1, def_hblank);
-	__v4l2_ctrl_s_ctrl(imx283->hblank, def_hblank);
+	imx283_set_hblank_limits(imx283);
 
 	/* Update limits and set FPS to default */
 	__v4l2_ctrl_modify_range(imx283->vblank, mode->min_VMAX - mode->height,
@@ -1056,7 +1880,7 @@ static void imx283_set_framing_limits(struct imx283 *imx283)
 
 	__v4l2_ctrl_modify_range(imx283->pixel_rate, pixel_rate, pixel_rate, 1, pixel_rate);
 
-	dev_info(imx283->dev,"Setting default HBLANK : %lld, VBLANK : %lld with PixelRate: %lld\n",def_hblank,mode->default_VMAX - mode->height, pixel_rate);
+	dev_info(imx283->dev,"Setting default VBLANK : %lld with PixelRate: %lld\n",mode->default_VMAX - mode->height, pixel_rate);
 
 }
 /* TODO */
@@ -1068,6 +1892,7 @@ static int imx283_set_pad_format(struct v4l2_subdev *sd,
 	const struct imx283_mode *mode;
 	struct imx283 *imx283 = to_imx283(sd);
 	const struct imx283_mode *mode_list;
+	const struct v4l2_fract *fi;
 	unsigned int num_modes;
 
 	mutex_lock(&imx283->mutex);
@@ -1076,13 +1901,26 @@ static int imx283_set_pad_format(struct v4l2_subdev *sd,
 	fmt->format.code = imx283_get_format_code(imx283,
 							fmt->format.code);
 
-	get_mode_table(fmt->format.code, &mode_list, &num_modes);
-
-	mode = v4l2_find_nearest_size(mode_list,
-					num_modes,
-					width, height,
-					fmt->format.width,
-					fmt->format.height);
+	/*
+	 * When the client has asked for a frame interval, prefer the cheapest
+	 * mode able to deliver it, falling back to the nearest size.
+	 */
+	fi = &imx283->frame_interval;
+	mode = NULL;
+	if (fi->numerator && fi->denominator)
+		mode = imx283_find_mode_for_interval(&fmt->format.code,
+						     fmt->format.width,
+						     fmt->format.height, fi);
+
+	if (!mode) {
+		get_mode_table(fmt->format.code, &mode_list, &num_modes);
+
+		mode = v4l2_find_nearest_size(mode_list,
+						num_modes,
+						width, height,
+						fmt->format.width,
+						fmt->format.height);
+	}
 	imx283_update_image_pad_format(imx283, mode, fmt);
 	if (fmt->which == V4L2_SUBDEV_FORMAT_TRY) {
 		framefmt = v4l2_subdev_get_try_format(sd, sd_state,
@@ -1092,6 +1930,7 @@ static int imx283_set_pad_format(struct v4l2_subdev *sd,
 		imx283->mode = mode;
 		imx283->fmt_code = fmt->format.code;
 		imx283_set_framing_limits(imx283);
+		imx283_apply_frame_interval(imx283);
 	}
 
 	mutex_unlock(&imx283->mutex);
@@ -1114,7 +1953,20 @@ __imx283_get_pad_crop(struct imx283 *imx283,
 	return NULL;
 }
 
-static int imx283_standby_cancel(struct imx283 *imx283)
+/* Sleep until the end of a stabilisation period, if not already over */
+static void imx283_wait_until(ktime_t deadline)
+{
+	s64 remaining = ktime_us_delta(deadline, ktime_get());
+
+	if (remaining > 0)
+		usleep_range(remaining, remaining + 1000);
+}
+
+/*
+ * Bring up the PLL and MIPI link. The 1st stabilisation period starts
+ * once this returns, and ends at the returned deadline.
+ */
+static int imx283_standby_cancel(struct imx283 *imx283, ktime_t *deadline)
 {
 	int ret = 0;
 
@@ -1140,31 +1992,19 @@ static int imx283_standby_cancel(struct imx283 *imx283)
 			    link_freq_reglist[imx283->link_freq_idx].num_of_regs,
 			    &ret);
 
-	usleep_range(1000, 2000); /* 1st Stabilisation period of 1 ms or more */
-
-	/* Activate */
-	cci_write(imx283, IMX283_REG_STANDBY, IMX283_ACTIVE, &ret);
-	usleep_range(19000, 20000); /* 2nd Stabilisation period of 19ms or more */
-
-	cci_write(imx283, IMX283_REG_CLAMP, IMX283_CLPSQRST, &ret);
-	cci_write(imx283, IMX283_REG_XMSTA, 0, &ret);
-	cci_write(imx283, IMX283_REG_SYNCDRV, IMX283_SYNCDRV_XHS_XVS, &ret);
+	/* 1st Stabilisation period of 1 ms or more */
+	*deadline = ktime_add_us(ktime_get(), 1000);
 
 	return ret;
 }
 
-/* Start streaming */
-static int imx283_start_streaming(struct imx283 *imx283)
+/* Readout mode and framing registers, all writable in standby */
+static int imx283_write_mode_regs(struct imx283 *imx283)
 {
 	const struct imx283_readout_mode *readout;
 	const struct imx283_mode *mode = imx283->mode;
-	int ret;
-
-	ret = imx283_standby_cancel(imx283);
-	if (ret) {
-		dev_err(imx283->dev, "failed to cancel standby\n");
-		return ret;
-	}
+	u32 rows, top;
+	int ret = 0;
 
 	/* Set the readout mode registers */
 	readout = &imx283_readout_modes[imx283->mode->mode];
@@ -1195,6 +2035,15 @@ static int imx283_start_streaming(struct imx283 *imx283)
 		mode->crop.width,
 		mode->crop.height);
 
+	/*
+	 * Vertical window, relative to the rows the drive mode reads out. Both
+	 * are 0 when the crop covers that readout.
+	 */
+	rows = readout->rows ? readout->rows : imx283_active_area.height;
+	top = imx283_active_area.top + (imx283_active_area.height - rows) / 2;
+	cci_write(imx283, IMX283_REG_VWINPOS, mode->crop.top - top, &ret);
+	cci_write(imx283, IMX283_REG_VWIDCUT, rows - mode->crop.height, &ret);
+
 	/* Todo: Update for arbitrary vertical cropping */
 	cci_write(imx283, IMX283_REG_Y_OUT_SIZE,
 		  mode->height - mode->vertical_ob, &ret);
@@ -1211,16 +2060,92 @@ static int imx283_start_streaming(struct imx283 *imx283)
 	cci_write(imx283, IMX283_REG_HTRIMMING_END,
 		  mode->crop.left + mode->crop.width + 1, &ret);
 
-	/* Todo: These must be calculated based on the link-freq and mode */
-	cci_write(imx283, IMX283_REG_HMAX, mode->default_HMAX, &ret);
-	cci_write(imx283, IMX283_REG_VMAX, mode->default_VMAX, &ret);
-	cci_write(imx283, IMX283_REG_SHR, mode->min_SHR, &ret);
+	/*
+	 * HMAX, VMAX and SHR are programmed from the HBLANK, VBLANK and
+	 * exposure controls.
+	 */
 
 	/* Disable embedded data */
 	cci_write(imx283, IMX283_REG_EBD_X_OUT_SIZE, 0, &ret);
 
+	return ret;
+}
+
+/*
+ * Start streaming
+ *
+ * The registers are programmed during the two stabilisation periods that
+ * follow the PLL start up and the standby release, rather than after them,
+ * so the first frame is available as early as possible.
+ */
+static int __imx283_start_streaming(struct imx283 *imx283)
+{
+	ktime_t deadline;
+	int ret;
+
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_PLL);
+	ret = imx283_standby_cancel(imx283, &deadline);
+	if (ret) {
+		dev_err(imx283->dev, "failed to cancel standby\n");
+		return ret;
+	}
+
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_MODE);
+	ret = imx283_write_mode_regs(imx283);
+	if (ret)
+		return ret;
+
+	imx283_wait_until(deadline);
+
+	/* Activate */
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_STREAM_ON);
+	ret = cci_write(imx283, IMX283_REG_STANDBY, IMX283_ACTIVE, NULL);
+	if (ret)
+		return ret;
+
+	/* 2nd Stabilisation period of 19ms or more */
+	deadline = ktime_add_us(ktime_get(), 19000);
+
+	if (imx283->burst_frames->val)
+		imx283_burst_set_vblank(imx283);
+
 	/* Apply customized values from user */
 	ret =  __v4l2_ctrl_handler_setup(imx283->sd.ctrl_handler);
+	if (ret)
+		return ret;
+
+	/* A single frame burst is lengthened from the start */
+	if (imx283->burst_frames->val) {
+		ret = imx283_burst_write_vmax(imx283,
+					      imx283->burst_frames->val == 1);
+		if (ret)
+			return ret;
+	}
+
+	imx283_wait_until(deadline);
+
+	cci_write(imx283, IMX283_REG_CLAMP, IMX283_CLPSQRST, &ret);
+	cci_write(imx283, IMX283_REG_XMSTA, 0, &ret);
+	cci_write(imx283, IMX283_REG_SYNCDRV, IMX283_SYNCDRV_XHS_XVS, &ret);
+	if (ret)
+		return ret;
+
+	imx283->stream_start = ktime_get();
+	imx283->burst_in_standby = false;
+	if (imx283->burst_frames->val)
+		imx283_burst_arm(imx283);
+
+	return ret;
+}
+
+static int imx283_start_streaming(struct imx283 *imx283)
+{
+	int ret;
+
+	ret = __imx283_start_streaming(imx283);
+	if (ret)
+		imx283_burst_restore_vblank(imx283);
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_OTHER);
 
 	return ret;
 }
@@ -1230,9 +2155,76 @@ static void imx283_stop_streaming(struct imx283 *imx283)
 {
 	int ret;
 
+	hrtimer_cancel(&imx283->burst_timer);
+	imx283->burst_armed = false;
+	imx283->burst_in_standby = false;
+	imx283_burst_restore_vblank(imx283);
+
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_STREAM_OFF);
 	ret = cci_write(imx283, IMX283_REG_STANDBY, IMX283_STBLOGIC, NULL);
 	if (ret)
 		dev_err(imx283->dev, "%s failed to set stream\n", __func__);
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_OTHER);
+}
+
+static enum hrtimer_restart imx283_burst_timer_fn(struct hrtimer *timer)
+{
+	struct imx283 *imx283 = container_of(timer, struct imx283, burst_timer);
+
+	queue_work(system_highpri_wq, &imx283->burst_work);
+
+	return HRTIMER_NORESTART;
+}
+
+static void imx283_burst_work(struct work_struct *work)
+{
+	struct imx283 *imx283 = container_of(work, struct imx283, burst_work);
+	static const struct v4l2_event ev = {
+		.type = V4L2_EVENT_EOS,
+	};
+	int ret;
+
+	mutex_lock(&imx283->mutex);
+
+	/*
+	 * The stream may have been stopped while the work was pending, or
+	 * restarted with a timer that hasn't expired yet.
+	 */
+	if (!imx283->streaming || !imx283->burst_armed ||
+	    ktime_before(ktime_get(), imx283->burst_deadline))
+		goto unlock;
+
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_BURST);
+
+	if (!imx283->burst_extended) {
+		ret = imx283_burst_write_vmax(imx283, true);
+		if (ret)
+			dev_err(imx283->dev, "%s failed to extend the last frame\n",
+				__func__);
+
+		imx283->burst_extended = true;
+		imx283->burst_deadline = imx283->burst_standby;
+		hrtimer_start(&imx283->burst_timer, imx283->burst_deadline,
+			      HRTIMER_MODE_ABS);
+		goto unlock;
+	}
+
+	imx283->burst_armed = false;
+
+	ret = cci_write(imx283, IMX283_REG_STANDBY, IMX283_STBLOGIC, NULL);
+	if (ret) {
+		dev_err(imx283->dev, "%s failed to enter standby\n", __func__);
+		goto unlock;
+	}
+
+	imx283->burst_in_standby = true;
+	imx283_burst_restore_vblank(imx283);
+
+	v4l2_subdev_notify_event(&imx283->sd, &ev);
+
+unlock:
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_OTHER);
+	mutex_unlock(&imx283->mutex);
 }
 
 static int imx283_set_stream(struct v4l2_subdev *sd, int enable)
@@ -1399,6 +2391,103 @@ static int imx283_identify_module(struct imx283 *imx283)
 	return 0;
 }
 
+/*
+ * Register ranges dumped through debugfs. They cover every register the
+ * driver programs, so the dump is the complete state the sensor was
+ * configured into.
+ */
+static const struct {
+	u16 start;
+	u16 len;
+} imx283_dump_ranges[] = {
+	{ 0x3000, 0x5c },	/* STANDBY .. HTRIMMING_END */
+	{ 0x30f6, 0x02 },	/* MDSEL18 */
+	{ 0x3104, 0x04 },	/* SYSMODE .. SYNCDRV */
+	{ 0x3156, 0x02 },	/* TPG_CTRL, TPG_PAT */
+	{ 0x320b, 0x01 },	/* STBPL */
+	{ 0x36aa, 0x01 },	/* PLSTMG02 */
+	{ 0x36c1, 0x05 },	/* PLRD1, PLRD2, 0x36c5 */
+	{ 0x36f7, 0x02 },	/* PLRD3, PLRD4 */
+	{ 0x3a54, 0x02 },	/* EBD_X_OUT_SIZE */
+	{ 0x3ac4, 0x01 },
+};
+
+/*
+ * Dump the registers one byte per line, as "address: value". Only possible
+ * while the sensor is powered, typically after stream on.
+ */
+static int imx283_registers_show(struct seq_file *m, void *data)
+{
+	struct imx283 *imx283 = m->private;
+	unsigned int i, j;
+	int ret = 0;
+	u64 val;
+
+	if (pm_runtime_get_if_in_use(imx283->dev) <= 0)
+		return -ENODEV;
+
+	mutex_lock(&imx283->mutex);
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_DEBUGFS);
+
+	for (i = 0; i < ARRAY_SIZE(imx283_dump_ranges); i++) {
+		for (j = 0; j < imx283_dump_ranges[i].len; j++) {
+			u16 addr = imx283_dump_ranges[i].start + j;
+
+			ret = cci_read(imx283, CCI_REG8(addr), &val, NULL);
+			if (ret)
+				goto unlock;
+
+			seq_printf(m, "%04x: %02llx\n", addr, val);
+		}
+	}
+
+unlock:
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_OTHER);
+	mutex_unlock(&imx283->mutex);
+	pm_runtime_put(imx283->dev);
+
+	return ret;
+}
+DEFINE_SHOW_ATTRIBUTE(imx283_registers);
+
+/* Transactions, bytes and bus time accumulated per originating tag */
+static int imx283_cci_stats_show(struct seq_file *m, void *data)
+{
+	struct imx283 *imx283 = m->private;
+	unsigned int i;
+
+	seq_printf(m, "%-14s %10s %10s %12s\n",
+		   "tag", "transfers", "bytes", "time_us");
+
+	mutex_lock(&imx283->mutex);
+
+	for (i = 0; i < IMX283_CCI_NUM_TAGS; i++) {
+		const struct imx283_cci_stats *stats = &imx283->cci_stats[i];
+
+		seq_printf(m, "%-14s %10llu %10llu %12llu\n",
+			   imx283_cci_tag_names[i], stats->transfers,
+			   stats->bytes, div_u64(stats->time_ns, NSEC_PER_USEC));
+	}
+
+	mutex_unlock(&imx283->mutex);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(imx283_cci_stats);
+
+static void imx283_debugfs_init(struct imx283 *imx283)
+{
+	char name[32];
+
+	snprintf(name, sizeof(name), "imx283-%s", dev_name(imx283->dev));
+	imx283->debugfs = debugfs_create_dir(name, NULL);
+
+	debugfs_create_file("registers", 0400, imx283->debugfs, imx283,
+			    &imx283_registers_fops);
+	debugfs_create_file("cci_stats", 0400, imx283->debugfs, imx283,
+			    &imx283_cci_stats_fops);
+}
+
 static int imx283_get_selection(struct v4l2_subdev *sd,
 				struct v4l2_subdev_state *sd_state,
 				struct v4l2_subdev_selection *sel)
@@ -1431,13 +2520,65 @@ static int imx283_get_selection(struct v4l2_subdev *sd,
 }
 
 
+static int imx283_subscribe_event(struct v4l2_subdev *sd, struct v4l2_fh *fh,
+				  struct v4l2_event_subscription *sub)
+{
+	switch (sub->type) {
+	case V4L2_EVENT_EOS:
+		/* Signalled when a burst has completed */
+		return v4l2_event_subscribe(fh, sub, 0, NULL);
+	default:
+		return v4l2_ctrl_subdev_subscribe_event(sd, fh, sub);
+	}
+}
+
 static const struct v4l2_subdev_core_ops imx283_core_ops = {
-	.subscribe_event = v4l2_ctrl_subdev_subscribe_event,
+	.subscribe_event = imx283_subscribe_event,
 	.unsubscribe_event = v4l2_event_subdev_unsubscribe,
 };
 
+static int imx283_g_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct imx283 *imx283 = to_imx283(sd);
+
+	mutex_lock(&imx283->mutex);
+	imx283_get_achieved_interval(imx283, &fi->interval);
+	mutex_unlock(&imx283->mutex);
+
+	return 0;
+}
+
+/*
+ * The requested interval is remembered for mode selection in set_fmt and
+ * applied to the current mode through VBLANK. The interval actually achieved
+ * is reported back to the caller.
+ */
+static int imx283_s_frame_interval(struct v4l2_subdev *sd,
+				   struct v4l2_subdev_frame_interval *fi)
+{
+	struct imx283 *imx283 = to_imx283(sd);
+
+	mutex_lock(&imx283->mutex);
+
+	if (fi->interval.numerator && fi->interval.denominator)
+		imx283->frame_interval = fi->interval;
+	else
+		imx283->frame_interval = (struct v4l2_fract){ 0, 0 };
+
+	imx283_update_link(imx283, false);
+	imx283_apply_frame_interval(imx283);
+	imx283_get_achieved_interval(imx283, &fi->interval);
+
+	mutex_unlock(&imx283->mutex);
+
+	return 0;
+}
+
 static const struct v4l2_subdev_video_ops imx283_video_ops = {
 	.s_stream = imx283_set_stream,
+	.g_frame_interval = imx283_g_frame_interval,
+	.s_frame_interval = imx283_s_frame_interval,
 };
 
 static const struct v4l2_subdev_pad_ops imx283_pad_ops = {
@@ -1446,6 +2587,7 @@ static const struct v4l2_subdev_pad_ops imx283_pad_ops = {
 	.set_fmt = imx283_set_pad_format,
 	.get_selection = imx283_get_selection,
 	.enum_frame_size = imx283_enum_frame_size,
+	.enum_frame_interval = imx283_enum_frame_interval,
 };
 
 static const struct v4l2_subdev_ops imx283_subdev_ops = {
@@ -1468,7 +2610,7 @@ static int imx283_init_controls(struct imx283 *imx283)
 	int ret;
 
 	ctrl_hdlr = &imx283->ctrl_handler;
-	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 16);
+	ret = v4l2_ctrl_handler_init(ctrl_hdlr, 20);
 	if (ret)
 		return ret;
 
@@ -1491,7 +2633,8 @@ static int imx283_init_controls(struct imx283 *imx283)
 						   &imx283_ctrl_ops,
 						   V4L2_CID_LINK_FREQ,
 						   ARRAY_SIZE(link_frequencies) - 1,
-						   0, link_frequencies);
+						   imx283->link_freq_idx,
+						   link_frequencies);
 	if (imx283->link_freq)
 		imx283->link_freq->flags |= V4L2_CTRL_FLAG_READ_ONLY;
 
@@ -1535,6 +2678,18 @@ static int imx283_init_controls(struct imx283 *imx283)
 				     ARRAY_SIZE(imx283_tpg_menu) - 1,
 				     0, 0, imx283_tpg_menu);
 
+	imx283->burst_frames = v4l2_ctrl_new_custom(ctrl_hdlr,
+						    &imx283_burst_frames_ctrl,
+						    NULL);
+	v4l2_ctrl_new_custom(ctrl_hdlr, &imx283_burst_trigger_ctrl, NULL);
+
+	imx283->low_power = v4l2_ctrl_new_custom(ctrl_hdlr,
+						 &imx283_low_power_ctrl, NULL);
+
+
+	imx283->min_skew = v4l2_ctrl_new_custom(ctrl_hdlr,
+						&imx283_min_skew_ctrl, NULL);
+
 	if (ctrl_hdlr->error) {
 		ret = ctrl_hdlr->error;
 		dev_err(&client->dev, "%s control init failed (%d)\n",
@@ -1617,7 +2772,7 @@ static int imx283_parse_endpoint(struct imx283 *imx283)
 	for (i = 0; i < bus_cfg.nr_of_link_frequencies; i++) {
 		for (j = 0; j < ARRAY_SIZE(link_frequencies); j++) {
 			if (bus_cfg.link_frequencies[i] == link_frequencies[j]) {
-				imx283->link_freq_idx = j;
+				set_bit(j, &imx283->link_freq_bitmap);
 				break;
 			}
 		}
@@ -1629,6 +2784,11 @@ static int imx283_parse_endpoint(struct imx283 *imx283)
 		}
 	}
 
+	/* Stream at the fastest rate the endpoint allows by default */
+	imx283->default_link_freq_idx = find_first_bit(&imx283->link_freq_bitmap,
+						       ARRAY_SIZE(link_frequencies));
+	imx283->link_freq_idx = imx283->default_link_freq_idx;
+
 done_endpoint_free:
 	v4l2_fwnode_endpoint_free(&bus_cfg);
 
@@ -1704,13 +2864,20 @@ static int imx283_probe(struct i2c_client *client)
 	if (ret)
 		return ret;
 
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_PROBE);
 	ret = imx283_identify_module(imx283);
+	imx283_cci_set_tag(imx283, IMX283_CCI_TAG_OTHER);
 	if (ret)
 		goto error_power_off;
 
 	/* Initialize default format */
 	imx283_set_default_format(imx283);
 
+	hrtimer_init(&imx283->burst_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	imx283->burst_timer.function = imx283_burst_timer_fn;
+	INIT_WORK(&imx283->burst_work, imx283_burst_work);
+
+
 	/* Enable runtime PM and turn off the device */
 	pm_runtime_set_active(dev);
 	pm_runtime_enable(dev);
@@ -1742,6 +2909,8 @@ static int imx283_probe(struct i2c_client *client)
 		goto error_media_entity;
 	}
 
+	imx283_debugfs_init(imx283);
+
 	return 0;
 
 error_media_entity:
@@ -1764,8 +2933,14 @@ static void imx283_remove(struct i2c_client *client)
 	struct v4l2_subdev *sd = i2c_get_clientdata(client);
 	struct imx283 *imx283 = to_imx283(sd);
 
+	debugfs_remove_recursive(imx283->debugfs);
+
 	v4l2_async_unregister_subdev(sd);
 	media_entity_cleanup(&sd->entity);
+
+	hrtimer_cancel(&imx283->burst_timer);
+	cancel_work_sync(&imx283->burst_work);
+
 	imx283_free_controls(imx283);
 
 	pm_runtime_disable(imx283->dev);